@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // pipe2
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -5,6 +6,9 @@
 #include <string.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
 
 #define MAX_LINE 512 // Maximum length of a command line
 #define MAX_ARGS 10 // Maximum number of arguments to a command
@@ -12,6 +16,13 @@
 #define MAX_HISTORY 20 //max of history memory storage
 
 #define BUFFER_SIZE 1024 
+#define LOG_BUFFER_SIZE (64 * 1024) // stdio buffer for the batch log file
+#define CAPTURE_CHUNK 4096 // read size when draining a child's pipes
+#define CAPTURE_LIMIT (1024 * 1024) // most output kept per stream of a batch command
+#define BATCH_SKIP_STATUS 127 // status logged for batch lines that were not run
+#define BATCH_USAGE \
+    "Usage: shell [batchfile] | shell -l logfile batchfile\n" \
+    "-l logfile - capture the output of every batch command into logfile"
 #define ALIAS_USAGE \
     "Usage of alias:\n" \
     "alias                      - Display a list of all aliases\n" \
@@ -295,9 +306,21 @@ alias_ptr_t execute_alias_command(char* command, alias_ptr_t alias_ptr)
 }
 
 
-void execute_commands(char** args, int input_fd, int output_fd) {
+// converts a waitpid status into a shell style exit status
+int exit_status(int status)
+{
+    if(WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if(WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return 1;
+}
+
+// returns the exit status of the executed command
+int execute_commands(char** args, int input_fd, int output_fd) {
 
 	pid_t pid = fork(); // Create a child process
+    int status = 0;
 
     if (pid == 0) { // Child process
         // Redirect input/output streams if necessary
@@ -312,15 +335,337 @@ void execute_commands(char** args, int input_fd, int output_fd) {
         // Execute the command
         execvp(args[0], args);
         perror("execvp"); // Print an error message if execvp fails
-        exit(1);
+        _exit(1); // don't flush stdio buffers inherited from the parent
     } else if (pid > 0) { // Parent process
-        int status;
         waitpid(pid, &status, 0); // Wait for the child process to finish
     } else { // Error forking
         perror("fork");
         exit(1);
     }
-	
+
+    return exit_status(status);
+}
+
+typedef struct Capture capture_t;
+
+// heap buffer holding up to CAPTURE_LIMIT bytes of what a child wrote to one stream
+struct Capture
+{
+    char* data;
+    size_t length;
+    size_t capacity;
+    size_t dropped; // bytes read but not kept
+};
+
+/* reads one chunk from fd into the capture and returns the result of read;
+ output past CAPTURE_LIMIT, or that can't be allocated, is still drained
+ so the child never blocks but is only counted as dropped */
+ssize_t capture_read(capture_t* capture, int fd)
+{
+    char chunk[CAPTURE_CHUNK];
+    ssize_t n;
+
+    do {
+        n = read(fd, chunk, sizeof(chunk));
+    } while(n == -1 && errno == EINTR);
+
+    if(n <= 0)
+        return n;
+
+    size_t keep = n;
+    if(capture->dropped > 0)
+        keep = 0; // keep the stored output contiguous
+    else if(capture->length + keep > CAPTURE_LIMIT)
+        keep = CAPTURE_LIMIT - capture->length;
+
+    if(capture->length + keep > capture->capacity)
+    {
+        size_t capacity = capture->capacity ? capture->capacity * 2 : CAPTURE_CHUNK * 2;
+        if(capacity > CAPTURE_LIMIT)
+            capacity = CAPTURE_LIMIT;
+
+        char* data = realloc(capture->data, capacity);
+        if(data == NULL)
+        {
+            keep = 0;
+        }
+        else
+        {
+            capture->data = data;
+            capture->capacity = capacity;
+        }
+    }
+
+    if(keep > 0)
+        memcpy(capture->data + capture->length, chunk, keep);
+    capture->length += keep;
+    capture->dropped += n - keep;
+
+    return n;
+}
+
+typedef struct BatchRecord batch_record_t;
+
+// where a batch command's record lives in the log and how it ended
+struct BatchRecord
+{
+    int line;
+    int status;
+    double duration;
+    long offset;
+};
+
+typedef struct BatchLog batch_log_t;
+
+// framed output log for batch mode with an index of every record
+struct BatchLog
+{
+    FILE* file;
+    char* buffer;
+    batch_record_t* records;
+    int count;
+    int capacity;
+};
+
+/* opens the log file with a large stdio buffer so that
+ the captured output is written in big blocks */
+bool batch_log_open(batch_log_t* log, const char* filename)
+{
+    *log = (batch_log_t) { 0 };
+
+    log->file = fopen(filename, "w");
+    if(log->file == NULL)
+        return false;
+
+    // batch commands must not inherit the log
+    fcntl(fileno(log->file), F_SETFD, FD_CLOEXEC);
+
+    log->buffer = malloc(LOG_BUFFER_SIZE);
+    if(log->buffer != NULL)
+        setvbuf(log->file, log->buffer, _IOFBF, LOG_BUFFER_SIZE);
+
+    return true;
+}
+
+/* remembers a record so it can be indexed and summarised later,
+ returns false if there was no memory for it */
+bool batch_log_add(batch_log_t* log, batch_record_t record)
+{
+    if(log->count == log->capacity)
+    {
+        int capacity = log->capacity ? log->capacity * 2 : 16;
+        batch_record_t* records = realloc(log->records, capacity * sizeof(batch_record_t));
+        if(records == NULL)
+        {
+            perror("realloc");
+            return false;
+        }
+        log->records = records;
+        log->capacity = capacity;
+    }
+
+    log->records[log->count++] = record;
+    return true;
+}
+
+/* writes one stream section of a record: a length header, with the number
+ of dropped bytes if the output was truncated, then exactly that many
+ bytes followed by a separating newline */
+void batch_log_stream(batch_log_t* log, const char* name, const capture_t* capture)
+{
+    fprintf(log->file, "@@ %s %zu", name, capture->length);
+    if(capture->dropped > 0)
+        fprintf(log->file, " truncated %zu", capture->dropped);
+    fputc('\n', log->file);
+    if(capture->length > 0)
+        fwrite(capture->data, 1, capture->length, log->file);
+    fputc('\n', log->file);
+}
+
+/* appends a framed record to the log and indexes it, returns false if
+ the log could not be written. A record looks like
+
+ @@ record <n> line <line> status <status> duration <seconds>
+ @@ argv <args...>
+ @@ stdout <length> [truncated <dropped>]
+ <length bytes>\n
+ @@ stderr <length> [truncated <dropped>]
+ <length bytes>\n
+ @@ end */
+bool batch_log_record(batch_log_t* log, char** args, batch_record_t record,
+    const capture_t* out, const capture_t* err)
+{
+    record.offset = ftell(log->file);
+
+    fprintf(log->file, "@@ record %d line %d status %d duration %.3f\n@@ argv",
+        log->count + 1, record.line, record.status, record.duration);
+    for (int i = 0; args[i] != NULL; i++)
+        fprintf(log->file, " %s", args[i]);
+    fputc('\n', log->file);
+
+    batch_log_stream(log, "stdout", out);
+    batch_log_stream(log, "stderr", err);
+    fputs("@@ end\n", log->file);
+
+    return !ferror(log->file) && batch_log_add(log, record);
+}
+
+/* records a batch line that was not run, with the reason as its stderr,
+ returns false if the log could not be written */
+bool batch_log_skip(batch_log_t* log, char** args, int line, const char* reason)
+{
+    char message[BUFFER_SIZE];
+    capture_t out = { 0 };
+    capture_t err = { .data = message };
+
+    err.length = snprintf(message, sizeof(message), "ERROR: %s", reason);
+
+    batch_record_t record = {
+        .line = line,
+        .status = BATCH_SKIP_STATUS
+    };
+
+    return batch_log_record(log, args, record, &out, &err);
+}
+
+/* runs a batch command with its stdout and stderr captured through
+ pipes and appends a framed record to the log; the exit status is stored
+ in status and false is returned if the log could not be written */
+bool execute_commands_logged(char** args, int line, batch_log_t* log, int* status_ptr)
+{
+    int out_pipe[2], err_pipe[2];
+    struct timespec start, end;
+    int status = 0;
+
+    if (pipe2(out_pipe, O_CLOEXEC) == -1 || pipe2(err_pipe, O_CLOEXEC) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Child process - send both streams to the pipes
+        close(out_pipe[0]);
+        close(err_pipe[0]);
+        dup2(out_pipe[1], STDOUT_FILENO);
+        dup2(err_pipe[1], STDERR_FILENO);
+        close(out_pipe[1]);
+        close(err_pipe[1]);
+
+        execvp(args[0], args);
+        perror("execvp");
+        _exit(127); // don't flush the log buffer inherited from the parent
+    } else if (pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+
+    // Parent process - drain both pipes until the child closes them
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+
+    capture_t out = { 0 }, err = { 0 };
+    struct pollfd fds[2] = {
+        { .fd = out_pipe[0], .events = POLLIN },
+        { .fd = err_pipe[0], .events = POLLIN }
+    };
+    capture_t* captures[2] = { &out, &err };
+    int open_fds = 2;
+
+    while (open_fds > 0) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (fds[i].fd != -1 && fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                if (capture_read(captures[i], fds[i].fd) <= 0) {
+                    close(fds[i].fd);
+                    fds[i].fd = -1; // poll ignores negative descriptors
+                    open_fds--;
+                }
+            }
+        }
+    }
+
+    // after a poll error, close the read ends so the child can't block on a full pipe
+    for (int i = 0; i < 2; i++) {
+        if (fds[i].fd != -1)
+            close(fds[i].fd);
+    }
+
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    batch_record_t record = {
+        .line = line,
+        .status = exit_status(status),
+        .duration = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9
+    };
+
+    bool logged = batch_log_record(log, args, record, &out, &err);
+
+    free(out.data);
+    free(err.data);
+
+    *status_ptr = record.status;
+    return logged;
+}
+
+/* writes the index of all records to the end of the log and closes it,
+ returns false if any write to the log failed; the last line holds the
+ offset of the index so a reader can seek straight to it */
+bool batch_log_close(batch_log_t* log)
+{
+    long index_offset = ftell(log->file);
+
+    fprintf(log->file, "@@ index %d\n", log->count);
+    for (int i = 0; i < log->count; i++)
+        fprintf(log->file, "%d line %d status %d offset %ld\n",
+            i + 1, log->records[i].line, log->records[i].status, log->records[i].offset);
+    fprintf(log->file, "@@ index-offset %ld\n", index_offset);
+
+    bool ok = !ferror(log->file);
+    if (fclose(log->file) != 0)
+        ok = false;
+    free(log->buffer);
+    log->file = NULL;
+    log->buffer = NULL;
+
+    return ok;
+}
+
+// frees the records kept for the index and summary
+void batch_log_free(batch_log_t* log)
+{
+    free(log->records);
+    *log = (batch_log_t) { 0 };
+}
+
+// prints how many batch commands ran and where the failed ones are in the log
+void batch_log_summary(const batch_log_t* log, const char* filename)
+{
+    int failed = 0;
+    double total = 0;
+
+    for (int i = 0; i < log->count; i++) {
+        total += log->records[i].duration;
+        if (log->records[i].status != 0)
+            failed++;
+    }
+
+    printf("batch: %d commands, %d succeeded, %d failed, %.3fs total\n",
+        log->count, log->count - failed, failed, total);
+    for (int i = 0; i < log->count; i++) {
+        if (log->records[i].status != 0)
+            printf("  line %d: status %d (%s offset %ld)\n", log->records[i].line,
+                log->records[i].status, filename, log->records[i].offset);
+    }
 }
 
 int main(int argc, char* argv[]) {
@@ -336,36 +681,105 @@ int main(int argc, char* argv[]) {
 	int num_commands = 0; //# of commands in batch mode
 	int batch_mode = 0; //batch mode indicator
 	FILE* batch_file = NULL; //pointer for batch mode
+	char* log_filename = NULL; //log file for batch mode output
+	batch_log_t batch_log; //captured batch output
+	int line_number = 0; //current line of the batch file
+	int failed_commands = 0; //batch commands that exited non-zero or were skipped
+	bool log_failed = false; //a write to the batch log failed
+	int opt;
 	
 	//path creation
     char* path = getenv("PATH");
     char path_copy[strlen(path) + 1];
     strcpy(path_copy, path);
 
-	if(argc == 2) {
+	while ((opt = getopt(argc, argv, "l:")) != -1) {
+		if (opt == 'l') {
+			log_filename = optarg;
+		} else {
+			puts(BATCH_USAGE);
+			exit(1);
+		}
+	}
+	if (argc - optind > 1 || (log_filename != NULL && optind == argc)) {
+		puts(BATCH_USAGE);
+		exit(1);
+	}
+	if(optind < argc) {
 		batch_mode = 1;
-		batch_file = fopen(argv[1], "r");
+		batch_file = fopen(argv[optind], "r");
 		if (batch_file == NULL) {
 			printf("ERROR: could not open batch file\n");
 			exit(1);
 		}
+		if (log_filename != NULL && !batch_log_open(&batch_log, log_filename)) {
+			printf("ERROR: could not open log file\n");
+			exit(1);
+		}
 	}
 	if (batch_mode) {
 		while (fgets(line, MAX_LINE, batch_file) != NULL) {
+			line_number++;
+			const char* skip_reason = NULL; //why this line can't be run
+			if (strchr(line, '\n') == NULL) {
+				// discard the rest of a line that didn't fit in the buffer
+				int c = fgetc(batch_file);
+				if (c != EOF && c != '\n') {
+					skip_reason = "line too long";
+					while (c != EOF && c != '\n')
+						c = fgetc(batch_file);
+				}
+			}
         	// Parse command and arguments
         	int num_args = 0;
         	char* token = strtok(line, " \n");
-        	while (token != NULL) {
+        	while (token != NULL && num_args < MAX_ARGS-1) {
             	args[num_args] = token;
             	num_args++;
             	token = strtok(NULL, " \n");
         }
 			args[num_args] = NULL;
+			if (token != NULL && skip_reason == NULL) {
+				skip_reason = "too many arguments";
+			}
+			if (skip_reason != NULL) {
+				// don't run a truncated command
+				fprintf(stderr, "ERROR: %s on line %d\n", skip_reason, line_number);
+				failed_commands++;
+				if (log_filename != NULL &&
+					!batch_log_skip(&batch_log, args, line_number, skip_reason)) {
+					log_failed = true;
+					break;
+				}
+				continue;
+			}
+			if (num_args == 0) {
+				continue; // skip blank lines
+			}
 			// Execute command
-			execute_commands(args, STDIN_FILENO, STDOUT_FILENO);
+			int status;
+			if (log_filename != NULL) {
+				if (!execute_commands_logged(args, line_number, &batch_log, &status)) {
+					log_failed = true;
+					break;
+				}
+			} else {
+				status = execute_commands(args, STDIN_FILENO, STDOUT_FILENO);
+			}
+			if (status != 0) {
+				failed_commands++;
+			}
         }
 			// Close batch file
 			fclose(batch_file);
+			if (log_filename != NULL) {
+				if (!batch_log_close(&batch_log) || log_failed) {
+					fprintf(stderr, "ERROR: could not write log file\n");
+					exit(1);
+				}
+				batch_log_summary(&batch_log, log_filename);
+				batch_log_free(&batch_log);
+			}
 	}
 	else{
 
@@ -664,6 +1078,6 @@ int main(int argc, char* argv[]) {
 
     // destroying the alias
     alias_ptr = alias_destroy(alias_ptr);
-    return 0;
+    return failed_commands > 0 ? 1 : 0;
 }
 